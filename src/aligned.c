@@ -0,0 +1,207 @@
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include "qoa.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* -----------------------------------------------------------------------------
+ Aligned reads
+
+ All frames of a QOA file written by qoa_encode() hold QOA_FRAME_LEN samples per
+ channel, except for the last one. The frames covering a window can therefore
+ be found by offset arithmetic and read without touching the rest of the file.
+ The files are independent of each other and decoded in parallel, each track
+ straight into its columns of the result. */
+
+/* Offsets past 2 GiB need a 64 bit seek, long is 32 bit on Windows */
+#ifdef _WIN32
+#define qoa_fseek _fseeki64
+#else
+#define qoa_fseek fseeko
+#endif
+
+enum {
+  QOA_ALIGNED_OK = 0,
+  QOA_ALIGNED_OPEN,
+  QOA_ALIGNED_READ,
+  QOA_ALIGNED_MALLOC,
+  QOA_ALIGNED_LAYOUT
+};
+
+typedef struct {
+  const char *fn;
+  qoa_desc qoa;
+  int column;       // first column of this track in the result
+  int status;
+} qoa_track_t;
+
+static int qoa_read_window(qoa_track_t *track, unsigned int from, unsigned int to, int *out, unsigned int rows) {
+  qoa_desc *qoa = &track->qoa;
+  int channels = qoa->channels;
+
+  if (from >= qoa->samples) return QOA_ALIGNED_OK;
+  if (to > qoa->samples) to = qoa->samples;
+
+  unsigned int first_frame = from / QOA_FRAME_LEN;
+  unsigned int last_frame = (to - 1) / QOA_FRAME_LEN;
+  unsigned int max_frame_size = QOA_FRAME_SIZE(channels, QOA_SLICES_PER_FRAME);
+
+  FILE *f = fopen(track->fn, "rb");
+  if (!f) return QOA_ALIGNED_OPEN;
+
+  unsigned char *bytes = malloc(max_frame_size);
+  short *frame_data = malloc(QOA_FRAME_LEN * channels * sizeof(short));
+  if (!bytes || !frame_data) {
+    fclose(f);
+    QOA_FREE(bytes);
+    QOA_FREE(frame_data);
+    return QOA_ALIGNED_MALLOC;
+  }
+
+  int status = QOA_ALIGNED_OK;
+  if (qoa_fseek(f, 8 + (qoa_uint64_t) first_frame * max_frame_size, SEEK_SET)) status = QOA_ALIGNED_READ;
+
+  for (unsigned int frame = first_frame; frame <= last_frame && status == QOA_ALIGNED_OK; frame++) {
+    unsigned int frame_start = frame * QOA_FRAME_LEN;
+    unsigned int expected_len = qoa_clamp(qoa->samples - frame_start, 0, QOA_FRAME_LEN);
+
+    // only the last frame of the file is shorter, its size is known as well
+    unsigned int slices = (expected_len + QOA_SLICE_LEN - 1) / QOA_SLICE_LEN;
+    unsigned int size = QOA_FRAME_SIZE(channels, slices);
+    if (fread(bytes, 1, size, f) != size) {
+      status = QOA_ALIGNED_READ;
+      break;
+    }
+
+    /* The frame header announces its own sample count, which tells us whether
+     the file really uses the fixed layout. Peek before decoding, so a bigger
+     frame can not overflow frame_data. */
+    unsigned int p = 0;
+    if (((qoa_read_u64(bytes, &p) >> 16) & 0xffff) != expected_len) {
+      status = QOA_ALIGNED_LAYOUT;
+      break;
+    }
+
+    unsigned int frame_len;
+    if (!qoa_decode_frame(bytes, size, qoa, frame_data, &frame_len)) {
+      status = QOA_ALIGNED_LAYOUT;
+      break;
+    }
+
+    // copy the part of this frame inside [from, to) into the columns
+    unsigned int start = from > frame_start ? from - frame_start : 0;
+    unsigned int end = qoa_clamp(to - frame_start, 0, frame_len);
+    for (int c = 0; c < channels; c++) {
+      int *column = out + (size_t)(track->column + c) * rows + (frame_start + start - from);
+      for (unsigned int i = start; i < end; i++) {
+        *column++ = frame_data[i * channels + c];
+      }
+    }
+  }
+
+  fclose(f);
+  QOA_FREE(bytes);
+  QOA_FREE(frame_data);
+  return status;
+}
+
+static void qoa_read_windows(qoa_track_t *tracks, int num_tracks, unsigned int from, unsigned int to, int *out, unsigned int rows, int threads) {
+#ifdef _OPENMP
+  if (threads <= 0) threads = omp_get_max_threads();
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+#endif
+  for (int i = 0; i < num_tracks; i++) {
+    tracks[i].status = qoa_read_window(&tracks[i], from, to, out, rows);
+  }
+}
+
+SEXP qoaReadAligned_(SEXP sFilenames, SEXP sFrom, SEXP sTo, SEXP sThreads) {
+  if (TYPEOF(sFilenames) != STRSXP || LENGTH(sFilenames) < 1) Rf_error("invalid filenames");
+
+  int num_tracks = LENGTH(sFilenames);
+  double from = Rf_asReal(sFrom);
+  double to = Rf_asReal(sTo);
+  int threads = Rf_asInteger(sThreads);
+
+  if (!(from >= 1) || !(to >= from) || to > 0xffffffff || to - from + 1 > 0x7fffffff)
+    Rf_error("invalid window [%g, %g]", from, to);
+
+  qoa_track_t *tracks = (qoa_track_t *) R_alloc(num_tracks, sizeof(qoa_track_t));
+
+  /* Read the file header plus the first frame header of every track. This
+   is all that is needed to lay out the result. */
+  int columns = 0;
+  for (int i = 0; i < num_tracks; i++) {
+    unsigned char header[QOA_MIN_FILESIZE];
+    tracks[i].fn = CHAR(STRING_ELT(sFilenames, i));
+
+    FILE *f = fopen(tracks[i].fn, "rb");
+    if (!f) Rf_error("unable to open %s", tracks[i].fn);
+    int bytes_read = fread(header, 1, QOA_MIN_FILESIZE, f);
+    fclose(f);
+
+    if (!qoa_decode_header(header, bytes_read, &tracks[i].qoa))
+      Rf_error("Decoding went wrong for %s!", tracks[i].fn);
+    if (tracks[i].qoa.samplerate != tracks[0].qoa.samplerate)
+      Rf_error("samplerate of %s (%d) differs from %s (%d)", tracks[i].fn, tracks[i].qoa.samplerate,
+               tracks[0].fn, tracks[0].qoa.samplerate);
+
+    tracks[i].column = columns;
+    tracks[i].status = QOA_ALIGNED_OK;
+    columns += tracks[i].qoa.channels;
+  }
+
+  unsigned int rows = to - from + 1;
+  SEXP res = PROTECT(allocMatrix(INTSXP, rows, columns));
+  int *samples_ = INTEGER(res);
+
+  // tracks ending before the window do not fill their columns
+  for (size_t i = 0; i < (size_t) rows * columns; i++) samples_[i] = NA_INTEGER;
+
+  qoa_read_windows(tracks, num_tracks, (unsigned int) from - 1, (unsigned int) to, samples_, rows, threads);
+
+  for (int i = 0; i < num_tracks; i++) {
+    switch (tracks[i].status) {
+    case QOA_ALIGNED_OPEN:
+      Rf_error("unable to open %s", tracks[i].fn);
+    case QOA_ALIGNED_READ:
+      Rf_error("unable to read %s, the file may be truncated", tracks[i].fn);
+    case QOA_ALIGNED_MALLOC:
+      Rf_error("Malloc error!");
+    case QOA_ALIGNED_LAYOUT:
+      Rf_error("%s is damaged or does not use fixed size frames, use readQOA() instead", tracks[i].fn);
+    }
+  }
+
+  SEXP channels = PROTECT(allocVector(INTSXP, num_tracks));
+  for (int i = 0; i < num_tracks; i++) INTEGER(channels)[i] = tracks[i].qoa.channels;
+
+  SEXP list_ = PROTECT(allocVector(VECSXP, 4));
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Add members to the list
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SET_VECTOR_ELT(list_, 0, res);
+  SET_VECTOR_ELT(list_, 1, channels);
+  SET_VECTOR_ELT(list_, 2, ScalarInteger(tracks[0].qoa.samplerate));
+  SET_VECTOR_ELT(list_, 3, ScalarInteger(rows));
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Set the names on the list.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP names = PROTECT(allocVector(STRSXP, 4));
+  SET_STRING_ELT(names, 0, mkChar("data"));
+  SET_STRING_ELT(names, 1, mkChar("channels"));
+  SET_STRING_ELT(names, 2, mkChar("samplerate"));
+  SET_STRING_ELT(names, 3, mkChar("samples"));
+
+  setAttrib(list_, R_NamesSymbol, names);
+
+  UNPROTECT(4);
+
+  return list_;
+}
@@ -0,0 +1,311 @@
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include "qoa.h"
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Arrow C data interface
+// see: https://arrow.apache.org/docs/format/CDataInterface.html
+// The structs are part of the stable ABI and are copied verbatim, so no
+// Arrow library is needed to produce them.
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+struct ArrowSchema {
+  // Array type description
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowSchema*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+struct ArrowArray {
+  // Array data description
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+
+  // Release callback
+  void (*release)(struct ArrowArray*);
+  // Opaque producer-specific data
+  void* private_data;
+};
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+static const char *qoa_channel_names[QOA_MAX_CHANNELS] = {
+  "FL", "FR", "FC", "LF", "BL", "BR", "FLC", "FRC"
+};
+
+// All children of a struct are allocated in one block together with the
+// pointer array, so a parent owns exactly one allocation besides itself.
+typedef struct {
+  struct ArrowSchema *child_ptrs[QOA_MAX_CHANNELS];
+  struct ArrowSchema child_structs[QOA_MAX_CHANNELS];
+} qoa_schema_private;
+
+typedef struct {
+  struct ArrowArray *child_ptrs[QOA_MAX_CHANNELS];
+  struct ArrowArray child_structs[QOA_MAX_CHANNELS];
+  const void *buffers[1];
+} qoa_array_private;
+
+typedef struct {
+  const void *buffers[2];
+  void *data;
+} qoa_column_private;
+
+static void qoa_release_schema(struct ArrowSchema *schema) {
+  qoa_schema_private *priv = (qoa_schema_private *) schema->private_data;
+  for (int c = 0; c < schema->n_children; c++) {
+    struct ArrowSchema *child = schema->children[c];
+    if (child->release) child->release(child);
+  }
+  QOA_FREE(priv);
+  schema->release = NULL;
+}
+
+static void qoa_release_child_schema(struct ArrowSchema *schema) {
+  // format and name are static strings, nothing to free
+  schema->release = NULL;
+}
+
+static void qoa_release_column(struct ArrowArray *array) {
+  qoa_column_private *priv = (qoa_column_private *) array->private_data;
+  QOA_FREE(priv->data);
+  QOA_FREE(priv);
+  array->release = NULL;
+}
+
+static void qoa_release_array(struct ArrowArray *array) {
+  qoa_array_private *priv = (qoa_array_private *) array->private_data;
+  for (int c = 0; c < array->n_children; c++) {
+    struct ArrowArray *child = array->children[c];
+    if (child->release) child->release(child);
+  }
+  QOA_FREE(priv);
+  array->release = NULL;
+}
+
+static void qoa_finalize_schema(SEXP ptr) {
+  struct ArrowSchema *schema = (struct ArrowSchema *) R_ExternalPtrAddr(ptr);
+  if (!schema) return;
+  if (schema->release) schema->release(schema);
+  QOA_FREE(schema);
+  R_ClearExternalPtr(ptr);
+}
+
+static void qoa_finalize_array(SEXP ptr) {
+  struct ArrowArray *array = (struct ArrowArray *) R_ExternalPtrAddr(ptr);
+  if (!array) return;
+  if (array->release) array->release(array);
+  QOA_FREE(array);
+  R_ClearExternalPtr(ptr);
+}
+
+static int qoa_fill_schema(struct ArrowSchema *schema, int channels, int as_float) {
+  qoa_schema_private *priv = QOA_MALLOC(sizeof(qoa_schema_private));
+  if (!priv) return 0;
+
+  for (int c = 0; c < channels; c++) {
+    struct ArrowSchema *child = &priv->child_structs[c];
+    child->format = as_float ? "f" : "s";
+    child->name = qoa_channel_names[c];
+    child->metadata = NULL;
+    child->flags = 0;
+    child->n_children = 0;
+    child->children = NULL;
+    child->dictionary = NULL;
+    child->release = &qoa_release_child_schema;
+    child->private_data = NULL;
+    priv->child_ptrs[c] = child;
+  }
+
+  schema->format = "+s";
+  schema->name = "";
+  schema->metadata = NULL;
+  schema->flags = 0;
+  schema->n_children = channels;
+  schema->children = priv->child_ptrs;
+  schema->dictionary = NULL;
+  schema->release = &qoa_release_schema;
+  schema->private_data = priv;
+  return 1;
+}
+
+// Decodes the file frame by frame and scatters the samples straight into one
+// column buffer per channel, so the interleaved stream is never materialised.
+static int qoa_fill_array(struct ArrowArray *array, const unsigned char *bytes, int size, qoa_desc *qoa, int as_float) {
+  unsigned int p = qoa_decode_header(bytes, size, qoa);
+  if (!p) return 0;
+
+  int channels = qoa->channels;
+  size_t width = as_float ? sizeof(float) : sizeof(int16_t);
+
+  qoa_array_private *priv = QOA_MALLOC(sizeof(qoa_array_private));
+  // a frame header may announce up to 0xffff samples, size the buffer for it
+  short *frame_data = QOA_MALLOC(0xffff * channels * sizeof(short));
+  if (!priv || !frame_data) {
+    QOA_FREE(priv);
+    QOA_FREE(frame_data);
+    return 0;
+  }
+
+  int columns_ok = 1;
+  for (int c = 0; c < channels; c++) {
+    qoa_column_private *col = QOA_MALLOC(sizeof(qoa_column_private));
+    void *data = col ? QOA_MALLOC(qoa->samples * width) : NULL;
+    if (!data) {
+      QOA_FREE(col);
+      columns_ok = 0;
+      col = NULL;
+    } else {
+      col->data = data;
+      col->buffers[0] = NULL;  // no validity bitmap, samples are never null
+      col->buffers[1] = data;
+    }
+
+    struct ArrowArray *child = &priv->child_structs[c];
+    child->length = 0;
+    child->null_count = 0;
+    child->offset = 0;
+    child->n_buffers = 2;
+    child->n_children = 0;
+    child->buffers = col ? col->buffers : NULL;
+    child->children = NULL;
+    child->dictionary = NULL;
+    child->release = col ? &qoa_release_column : NULL;
+    child->private_data = col;
+    priv->child_ptrs[c] = child;
+  }
+
+  priv->buffers[0] = NULL;
+  array->length = 0;
+  array->null_count = 0;
+  array->offset = 0;
+  array->n_buffers = 1;
+  array->n_children = channels;
+  array->buffers = priv->buffers;
+  array->children = priv->child_ptrs;
+  array->dictionary = NULL;
+  array->release = &qoa_release_array;
+  array->private_data = priv;
+
+  if (!columns_ok) {
+    QOA_FREE(frame_data);
+    array->release(array);
+    return 0;
+  }
+
+  unsigned int sample_index = 0;
+  unsigned int frame_len;
+  unsigned int frame_size;
+
+  do {
+    frame_size = qoa_decode_frame(bytes + p, size - p, qoa, frame_data, &frame_len);
+    if (sample_index + frame_len > qoa->samples) {
+      frame_len = qoa->samples - sample_index;
+    }
+
+    for (int c = 0; c < channels; c++) {
+      qoa_column_private *col = (qoa_column_private *) priv->child_structs[c].private_data;
+      if (as_float) {
+        float *out = (float *) col->data + sample_index;
+        for (unsigned int i = 0; i < frame_len; i++) out[i] = frame_data[i * channels + c] / 32768.0f;
+      } else {
+        int16_t *out = (int16_t *) col->data + sample_index;
+        for (unsigned int i = 0; i < frame_len; i++) out[i] = frame_data[i * channels + c];
+      }
+    }
+
+    p += frame_size;
+    sample_index += frame_len;
+  } while (frame_size && sample_index < qoa->samples);
+
+  QOA_FREE(frame_data);
+
+  qoa->samples = sample_index;
+  array->length = sample_index;
+  for (int c = 0; c < channels; c++) priv->child_structs[c].length = sample_index;
+
+  return 1;
+}
+
+SEXP qoaReadArrow_(SEXP sFilename, SEXP sFloat) {
+  const char *fn;
+  unsigned char *data;
+  qoa_desc qoa;
+  int bytes_read;
+
+  if (TYPEOF(sFilename) != STRSXP || LENGTH(sFilename) < 1) Rf_error("invalid filename");
+  fn = CHAR(STRING_ELT(sFilename, 0));
+  int as_float = Rf_asLogical(sFloat) == TRUE;
+
+  // allocate the (still empty) structs first and hand them to R, so the
+  // finalizers clean up whatever has been filled in if anything fails below
+  struct ArrowSchema *schema = QOA_MALLOC(sizeof(struct ArrowSchema));
+  if (schema) schema->release = NULL;
+  SEXP schema_ptr = PROTECT(R_MakeExternalPtr(schema, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(schema_ptr, &qoa_finalize_schema, TRUE);
+
+  struct ArrowArray *array = QOA_MALLOC(sizeof(struct ArrowArray));
+  if (array) array->release = NULL;
+  SEXP array_ptr = PROTECT(R_MakeExternalPtr(array, R_NilValue, R_NilValue));
+  R_RegisterCFinalizerEx(array_ptr, &qoa_finalize_array, TRUE);
+
+  if (!schema || !array) Rf_error("Malloc error!");
+
+  data = qoa_read_bytes(fn, &bytes_read);
+  int ok = qoa_fill_array(array, data, bytes_read, &qoa, as_float);
+  QOA_FREE(data);
+
+  if (!ok) Rf_error("Decoding went wrong!");
+  if (!qoa_fill_schema(schema, qoa.channels, as_float)) Rf_error("Malloc error!");
+
+  SEXP list_ = PROTECT(allocVector(VECSXP, 5));
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Add members to the list
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SET_VECTOR_ELT(list_, 0, schema_ptr);
+  SET_VECTOR_ELT(list_, 1, array_ptr);
+  SET_VECTOR_ELT(list_, 2, ScalarInteger(qoa.channels));
+  SET_VECTOR_ELT(list_, 3, ScalarInteger(qoa.samplerate));
+  SET_VECTOR_ELT(list_, 4, ScalarInteger(qoa.samples));
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Set the names on the list.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP names = PROTECT(allocVector(STRSXP, 5));
+  SET_STRING_ELT(names, 0, mkChar("schema"));
+  SET_STRING_ELT(names, 1, mkChar("array"));
+  SET_STRING_ELT(names, 2, mkChar("channels"));
+  SET_STRING_ELT(names, 3, mkChar("samplerate"));
+  SET_STRING_ELT(names, 4, mkChar("samples"));
+
+  setAttrib(list_, R_NamesSymbol, names);
+
+  UNPROTECT(4);
+
+  return list_;
+}
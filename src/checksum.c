@@ -0,0 +1,325 @@
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "qoa.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define QOA_CRC_SSE42
+#include <nmmintrin.h>
+#endif
+
+#if defined(__ARM_FEATURE_CRC32)
+#define QOA_CRC_ARM
+#include <arm_acle.h>
+#endif
+
+/* -----------------------------------------------------------------------------
+ Checksum sidecar
+
+ QOA has no checksums of its own. The sidecar stores a CRC32C (Castagnoli) for
+ the file header and for every frame, so damage can be narrowed down to single
+ frames without decoding anything. Like QOA itself it is BIG ENDIAN and built
+ from 64 bit words:
+
+ struct {
+ uint32_t magic;            // magic bytes 'qoac'
+ uint32_t num_regions;      // file header + number of frames
+ } sidecar_header;          // = 64 bits
+ struct {
+ uint32_t size;             // size of the region in bytes
+ uint32_t crc;              // CRC32C of the region
+ } regions[num_regions];    // = 64 bits each
+
+ The regions are contiguous and start at offset 0, so region 0 is the 8 byte
+ file header and region i is frame i. */
+
+#define QOA_CRC_MAGIC 0x716f6163 /* 'qoac' */
+
+static uint32_t qoa_crc_tab[256];
+
+static void qoa_crc_init(void) {
+  if (qoa_crc_tab[1]) return;
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int k = 0; k < 8; k++) {
+      crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+    }
+    qoa_crc_tab[i] = crc;
+  }
+}
+
+static uint32_t qoa_crc32c_sw(uint32_t crc, const unsigned char *bytes, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    crc = qoa_crc_tab[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+  }
+  return crc;
+}
+
+#ifdef QOA_CRC_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t qoa_crc32c_hw(uint32_t crc, const unsigned char *bytes, size_t size) {
+  size_t i = 0;
+#if defined(__x86_64__)
+  uint64_t crc64 = crc;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t v;
+    memcpy(&v, bytes + i, 8);
+    crc64 = _mm_crc32_u64(crc64, v);
+  }
+  crc = (uint32_t) crc64;
+#endif
+  for (; i < size; i++) {
+    crc = _mm_crc32_u8(crc, bytes[i]);
+  }
+  return crc;
+}
+#elif defined(QOA_CRC_ARM)
+static uint32_t qoa_crc32c_hw(uint32_t crc, const unsigned char *bytes, size_t size) {
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    uint64_t v;
+    memcpy(&v, bytes + i, 8);
+    crc = __crc32cd(crc, v);
+  }
+  for (; i < size; i++) {
+    crc = __crc32cb(crc, bytes[i]);
+  }
+  return crc;
+}
+#endif
+
+static int qoa_crc_has_hw(void) {
+#if defined(QOA_CRC_SSE42)
+  return __builtin_cpu_supports("sse4.2");
+#elif defined(QOA_CRC_ARM)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static uint32_t qoa_crc32c(const unsigned char *bytes, size_t size, int hw) {
+#if defined(QOA_CRC_SSE42) || defined(QOA_CRC_ARM)
+  if (hw) return ~qoa_crc32c_hw(0xffffffff, bytes, size);
+#endif
+  return ~qoa_crc32c_sw(0xffffffff, bytes, size);
+}
+
+/* Computes the checksums of all regions in parallel. Regions reaching beyond
+ the end of the file are left untouched. */
+static void qoa_crc_regions(const unsigned char *bytes, int size, const unsigned int *offsets, const unsigned int *sizes, uint32_t *crcs, int num_regions, int threads) {
+  int hw = qoa_crc_has_hw();
+  qoa_crc_init();
+#ifdef _OPENMP
+  if (threads <= 0) threads = omp_get_max_threads();
+#pragma omp parallel for schedule(dynamic, 16) num_threads(threads)
+#endif
+  for (int i = 0; i < num_regions; i++) {
+    if ((qoa_uint64_t)offsets[i] + sizes[i] <= (qoa_uint64_t)size) {
+      crcs[i] = qoa_crc32c(bytes + offsets[i], sizes[i], hw);
+    }
+  }
+}
+
+/* Rows from num_stored on are not covered by the sidecar and get no
+ checksum. */
+static SEXP qoa_crc_result(const unsigned int *offsets, const unsigned int *sizes, const uint32_t *crcs, const int *ok, int num_regions, int num_stored) {
+  char hex[9];
+  int n = ok ? 5 : 4;
+  SEXP list_ = PROTECT(allocVector(VECSXP, n));
+
+  SEXP frame = allocVector(INTSXP, num_regions);
+  SET_VECTOR_ELT(list_, 0, frame);
+  SEXP offset = allocVector(REALSXP, num_regions);
+  SET_VECTOR_ELT(list_, 1, offset);
+  SEXP size = allocVector(INTSXP, num_regions);
+  SET_VECTOR_ELT(list_, 2, size);
+  SEXP crc = allocVector(STRSXP, num_regions);
+  SET_VECTOR_ELT(list_, 3, crc);
+
+  for (int i = 0; i < num_regions; i++) {
+    INTEGER(frame)[i] = i;
+    REAL(offset)[i] = offsets[i];
+    INTEGER(size)[i] = sizes[i];
+    if (i < num_stored) {
+      snprintf(hex, sizeof(hex), "%08x", crcs[i]);
+      SET_STRING_ELT(crc, i, mkChar(hex));
+    } else {
+      SET_STRING_ELT(crc, i, NA_STRING);
+    }
+  }
+
+  if (ok) {
+    SEXP ok_ = allocVector(LGLSXP, num_regions);
+    SET_VECTOR_ELT(list_, 4, ok_);
+    for (int i = 0; i < num_regions; i++) LOGICAL(ok_)[i] = ok[i];
+  }
+
+  SEXP names = PROTECT(allocVector(STRSXP, n));
+  SET_STRING_ELT(names, 0, mkChar("frame"));
+  SET_STRING_ELT(names, 1, mkChar("offset"));
+  SET_STRING_ELT(names, 2, mkChar("size"));
+  SET_STRING_ELT(names, 3, mkChar("crc"));
+  if (ok) SET_STRING_ELT(names, 4, mkChar("ok"));
+
+  setAttrib(list_, R_NamesSymbol, names);
+
+  UNPROTECT(2);
+  return list_;
+}
+
+SEXP qoaChecksum_(SEXP sFilename, SEXP sSidecar, SEXP sThreads) {
+  const char *fn;
+  unsigned char *data;
+  int bytes_read;
+
+  if (TYPEOF(sFilename) != STRSXP || LENGTH(sFilename) < 1) Rf_error("invalid filename");
+  fn = CHAR(STRING_ELT(sFilename, 0));
+  if (sSidecar != R_NilValue && (TYPEOF(sSidecar) != STRSXP || LENGTH(sSidecar) < 1)) Rf_error("invalid sidecar filename");
+  int threads = Rf_asInteger(sThreads);
+
+  data = qoa_read_bytes(fn, &bytes_read);
+
+  qoa_desc qoa;
+  if (!qoa_decode_header(data, bytes_read, &qoa)) {
+    QOA_FREE(data);
+    Rf_error("Decoding went wrong!");
+  }
+
+  /* Walk the frame headers to find the frame boundaries. Every frame is at
+   least 8 bytes (its header), which bounds the number of regions. */
+  int max_regions = 1 + bytes_read / 8;
+  unsigned int *offsets = malloc(max_regions * sizeof(unsigned int));
+  unsigned int *sizes = malloc(max_regions * sizeof(unsigned int));
+  uint32_t *crcs = malloc(max_regions * sizeof(uint32_t));
+  if (!offsets || !sizes || !crcs) {
+    QOA_FREE(data);
+    QOA_FREE(offsets);
+    QOA_FREE(sizes);
+    QOA_FREE(crcs);
+    Rf_error("Malloc error!");
+  }
+
+  offsets[0] = 0;
+  sizes[0] = 8;
+  int num_regions = 1;
+  unsigned int p = 8;
+  while (p + 8 <= bytes_read) {
+    unsigned int q = p;
+    unsigned int frame_size = qoa_read_u64(data, &q) & 0xffff;
+    if (frame_size < 8 || p + frame_size > bytes_read) break;
+    offsets[num_regions] = p;
+    sizes[num_regions] = frame_size;
+    num_regions++;
+    p += frame_size;
+  }
+
+  if (p != bytes_read) {
+    QOA_FREE(data);
+    QOA_FREE(offsets);
+    QOA_FREE(sizes);
+    QOA_FREE(crcs);
+    Rf_error("invalid frame layout at byte %u of %s", p, fn);
+  }
+
+  qoa_crc_regions(data, bytes_read, offsets, sizes, crcs, num_regions, threads);
+  QOA_FREE(data);
+
+  if (sSidecar != R_NilValue) {
+    const char *sidecar_fn = CHAR(STRING_ELT(sSidecar, 0));
+    unsigned char *sidecar = malloc(8 * (num_regions + 1));
+    FILE *f = sidecar ? fopen(sidecar_fn, "wb") : NULL;
+    if (!f) {
+      QOA_FREE(sidecar);
+      QOA_FREE(offsets);
+      QOA_FREE(sizes);
+      QOA_FREE(crcs);
+      Rf_error("unable to create %s", sidecar_fn);
+    }
+
+    unsigned int q = 0;
+    qoa_write_u64((qoa_uint64_t)QOA_CRC_MAGIC << 32 | num_regions, sidecar, &q);
+    for (int i = 0; i < num_regions; i++) {
+      qoa_write_u64((qoa_uint64_t)sizes[i] << 32 | crcs[i], sidecar, &q);
+    }
+    fwrite(sidecar, 1, q, f);
+    fclose(f);
+    QOA_FREE(sidecar);
+  }
+
+  SEXP res = qoa_crc_result(offsets, sizes, crcs, NULL, num_regions, num_regions);
+  QOA_FREE(offsets);
+  QOA_FREE(sizes);
+  QOA_FREE(crcs);
+  return res;
+}
+
+SEXP qoaVerify_(SEXP sFilename, SEXP sSidecar, SEXP sThreads) {
+  const char *fn, *sidecar_fn;
+  unsigned char *data, *sidecar;
+  int bytes_read, sidecar_size;
+
+  if (TYPEOF(sFilename) != STRSXP || LENGTH(sFilename) < 1) Rf_error("invalid filename");
+  if (TYPEOF(sSidecar) != STRSXP || LENGTH(sSidecar) < 1) Rf_error("invalid sidecar filename");
+  fn = CHAR(STRING_ELT(sFilename, 0));
+  sidecar_fn = CHAR(STRING_ELT(sSidecar, 0));
+  int threads = Rf_asInteger(sThreads);
+
+  sidecar = qoa_read_bytes(sidecar_fn, &sidecar_size);
+
+  unsigned int q = 0;
+  qoa_uint64_t header = sidecar_size >= 8 ? qoa_read_u64(sidecar, &q) : 0;
+  int num_regions = header & 0xffffffff;
+  if ((header >> 32) != QOA_CRC_MAGIC || num_regions < 1 || (sidecar_size - 8) / 8 < num_regions) {
+    QOA_FREE(sidecar);
+    Rf_error("invalid sidecar %s", sidecar_fn);
+  }
+
+  /* R_alloc()ed, so nothing leaks if reading the QOA file below fails, e.g.
+   because it has been moved away. The sidecar is freed before that. */
+  unsigned int *offsets = (unsigned int *) R_alloc(num_regions + 1, sizeof(unsigned int));
+  unsigned int *sizes = (unsigned int *) R_alloc(num_regions + 1, sizeof(unsigned int));
+  uint32_t *expected = (uint32_t *) R_alloc(num_regions + 1, sizeof(uint32_t));
+  uint32_t *crcs = (uint32_t *) R_alloc(num_regions + 1, sizeof(uint32_t));
+  int *ok = (int *) R_alloc(num_regions + 1, sizeof(int));
+
+  qoa_uint64_t offset = 0;
+  for (int i = 0; i < num_regions; i++) {
+    qoa_uint64_t region = qoa_read_u64(sidecar, &q);
+    offsets[i] = offset;
+    sizes[i] = region >> 32;
+    expected[i] = region & 0xffffffff;
+    crcs[i] = 0;
+    offset += sizes[i];
+  }
+  QOA_FREE(sidecar);
+
+  data = qoa_read_bytes(fn, &bytes_read);
+  qoa_crc_regions(data, bytes_read, offsets, sizes, crcs, num_regions, threads);
+  QOA_FREE(data);
+
+  // regions cut off by a truncated file are corrupt as well
+  for (int i = 0; i < num_regions; i++) {
+    ok[i] = (qoa_uint64_t)offsets[i] + sizes[i] <= (qoa_uint64_t)bytes_read && crcs[i] == expected[i];
+  }
+
+  /* Bytes appended after the last region are not covered by any checksum,
+   so the file is not the one the sidecar was written for. They are
+   reported as an extra region that never verifies. */
+  int num_rows = num_regions;
+  if (offset < (qoa_uint64_t)bytes_read) {
+    offsets[num_rows] = offset;
+    sizes[num_rows] = bytes_read - offset;
+    ok[num_rows] = 0;
+    num_rows++;
+  }
+
+  return qoa_crc_result(offsets, sizes, expected, ok, num_rows, num_regions);
+}
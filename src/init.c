@@ -8,6 +8,12 @@
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 extern SEXP qoaRead_(SEXP);
 extern SEXP qoaWrite_(SEXP, SEXP, SEXP);
+extern SEXP qoaReadArrow_(SEXP, SEXP);
+extern SEXP qoaPacketize_(SEXP, SEXP, SEXP, SEXP);
+extern SEXP qoaDepacketize_(SEXP, SEXP, SEXP);
+extern SEXP qoaChecksum_(SEXP, SEXP, SEXP);
+extern SEXP qoaVerify_(SEXP, SEXP, SEXP);
+extern SEXP qoaReadAligned_(SEXP, SEXP, SEXP, SEXP);
 
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // .C      R_CMethodDef
@@ -17,6 +23,12 @@ static const R_CallMethodDef CEntries[] = {
   // name       pointer               Num args
   {"qoaRead_", (DL_FUNC) &qoaRead_, 1},
   {"qoaWrite_", (DL_FUNC) &qoaWrite_, 3},
+  {"qoaReadArrow_", (DL_FUNC) &qoaReadArrow_, 2},
+  {"qoaPacketize_", (DL_FUNC) &qoaPacketize_, 4},
+  {"qoaDepacketize_", (DL_FUNC) &qoaDepacketize_, 3},
+  {"qoaChecksum_", (DL_FUNC) &qoaChecksum_, 3},
+  {"qoaVerify_", (DL_FUNC) &qoaVerify_, 3},
+  {"qoaReadAligned_", (DL_FUNC) &qoaReadAligned_, 4},
   {NULL       , NULL                , 0}   // Placeholder to indicate last one.
 };
 
@@ -0,0 +1,429 @@
+#include <R.h>
+#include <Rinternals.h>
+
+#include <stdio.h>
+#include "qoa.h"
+
+/* -----------------------------------------------------------------------------
+ Packets
+
+ Every QOA frame carries its own header and LMS state, so a single frame can be
+ decoded without any of the frames before it. A packet is one such frame with
+ a 16 byte header in front of it (big endian, like the rest of QOA):
+
+ struct {
+ uint32_t magic;            // magic bytes 'qoap'
+ uint32_t sequence;         // packet counter, incremented per packet
+ uint64_t timestamp;        // index of the first sample of this frame
+ } packet_header;           // = 128 bits
+ followed by the frame (frame header, LMS state and slices).
+
+ The depacketizer places every frame by its timestamp, so packets may arrive
+ late, twice or not at all. Packets whose timestamp does not agree with their
+ sequence number are treated as lost. */
+
+#define QOA_PACKET_MAGIC 0x716f6170 /* 'qoap' */
+#define QOA_PACKET_HEADER_SIZE 16
+
+SEXP qoaPacketize_(SEXP sample_data, SEXP samplerate, SEXP sFrameLen, SEXP sSequence) {
+  if (TYPEOF(sample_data) != INTSXP)
+    Rf_error("samples must be a matrix or array of integer numbers");
+
+  SEXP dims = Rf_getAttrib(sample_data, R_DimSymbol);
+  if (dims == R_NilValue || TYPEOF(dims) != INTSXP || LENGTH(dims) < 1 || LENGTH(dims) > 8)
+    Rf_error("samples must be a matrix or an array of minimum one or maximum eight channels");
+
+  // prepare qoa_desc
+  qoa_desc qoa;
+  qoa.samplerate = Rf_asInteger(samplerate);
+  qoa.samples = INTEGER(dims)[0];
+  qoa.channels = LENGTH(dims) > 1 ? INTEGER(dims)[1] : 1;
+
+  int frame_len = Rf_asInteger(sFrameLen);
+  unsigned int sequence = (unsigned int) Rf_asInteger(sSequence);
+
+  if (qoa.samples == 0 || qoa.samplerate == 0 || qoa.samplerate > 0xffffff ||
+      qoa.channels == 0 || qoa.channels > QOA_MAX_CHANNELS)
+    Rf_error("Encoding went wrong!");
+  if (frame_len < 1 || frame_len > QOA_FRAME_LEN)
+    Rf_error("frame_len must be between 1 and %d", QOA_FRAME_LEN);
+
+  int num_packets = (qoa.samples + frame_len - 1) / frame_len;
+  SEXP res = PROTECT(allocVector(VECSXP, num_packets));
+
+  // R_alloc()ed, as reading ALTREP or file-backed input may raise an R error
+  int *column = (int *) R_alloc(frame_len, sizeof(int));
+  short *frame_values = (short *) R_alloc(frame_len * qoa.channels, sizeof(short));
+
+  qoa_encode_init(&qoa);
+
+  int packet_index = 0;
+  for (int sample_index = 0; sample_index < qoa.samples; sample_index += frame_len) {
+    int len = qoa_clamp(frame_len, 0, qoa.samples - sample_index);
+    qoa_get_frame(sample_data, &qoa, sample_index, len, column, frame_values);
+
+    unsigned int slices = (len + QOA_SLICE_LEN - 1) / QOA_SLICE_LEN;
+    SEXP packet = allocVector(RAWSXP, QOA_PACKET_HEADER_SIZE + QOA_FRAME_SIZE(qoa.channels, slices));
+    SET_VECTOR_ELT(res, packet_index++, packet);
+
+    unsigned char *bytes = RAW(packet);
+    unsigned int p = 0;
+    qoa_write_u64((qoa_uint64_t)QOA_PACKET_MAGIC << 32 | sequence++, bytes, &p);
+    qoa_write_u64(sample_index, bytes, &p);
+    qoa_encode_frame(frame_values, &qoa, len, bytes + p);
+  }
+
+  UNPROTECT(1);
+  return res;
+}
+
+typedef struct {
+  const unsigned char *frame;
+  unsigned int size;
+  unsigned int sequence;
+  unsigned int samples;
+  unsigned int format;      // channels << 24 | samplerate
+  int intact;               // format matches the stream
+  qoa_uint64_t timestamp;
+} qoa_packet_t;
+
+/* What the depacketizer expects next. It is handed back to R after every
+ call, so a live stream can be decoded window by window without drifting. */
+typedef struct {
+  int valid;
+  qoa_uint64_t timestamp;   // timestamp of the next sample
+  unsigned int sequence;    // sequence number of the next packet
+  unsigned int frame_len;   // samples per channel in a full frame
+} qoa_stream_t;
+
+// by timestamp, intact packets first so a broken duplicate never wins
+static int qoa_packet_cmp(const void *a, const void *b) {
+  const qoa_packet_t *pa = a, *pb = b;
+  if (pa->timestamp != pb->timestamp) return pa->timestamp < pb->timestamp ? -1 : 1;
+  return pb->intact - pa->intact;
+}
+
+static int qoa_int64_cmp(const void *a, const void *b) {
+  long long va = *(const long long *)a, vb = *(const long long *)b;
+  return (va > vb) - (va < vb);
+}
+
+static int qoa_uint_cmp(const void *a, const void *b) {
+  unsigned int va = *(const unsigned int *)a, vb = *(const unsigned int *)b;
+  return (va > vb) - (va < vb);
+}
+
+/* All frames of a stream but the last have the same length, so sequence
+ number and timestamp of a packet determine each other. The origin is the
+ timestamp a packet implies for the reference sequence number; it is the same
+ for every packet that is in place. */
+static long long qoa_packet_origin(const qoa_packet_t *packet, unsigned int ref_sequence, unsigned int frame_len) {
+  int distance = (int) (packet->sequence - ref_sequence);
+  return (long long) packet->timestamp - (long long) distance * frame_len;
+}
+
+/* Drops packets whose timestamp does not fit their sequence number, e.g.
+ because either was damaged in transit. Without a known stream state, frame
+ length and origin are taken as the medians over all packets, so a minority of
+ bad packets can not shift the stream. With a state, packets before the
+ expected one arrived too late and are dropped as well. Returns the number of
+ packets kept. */
+static int qoa_packet_filter(qoa_packet_t *packets, int num_packets, qoa_stream_t *stream) {
+  if (!num_packets) return 0;
+
+  if (!stream->valid) {
+    unsigned int *values = (unsigned int *) R_alloc(num_packets, sizeof(unsigned int));
+    long long *origins = (long long *) R_alloc(num_packets, sizeof(long long));
+
+    // upper median, so the shorter last frame of a stream is outvoted
+    for (int i = 0; i < num_packets; i++) values[i] = packets[i].samples;
+    qsort(values, num_packets, sizeof(unsigned int), qoa_uint_cmp);
+    stream->frame_len = values[num_packets / 2];
+
+    // origins are taken relative to the median sequence number, not to a single packet
+    for (int i = 0; i < num_packets; i++) values[i] = packets[i].sequence;
+    qsort(values, num_packets, sizeof(unsigned int), qoa_uint_cmp);
+    unsigned int ref_sequence = values[num_packets / 2];
+
+    for (int i = 0; i < num_packets; i++) origins[i] = qoa_packet_origin(&packets[i], ref_sequence, stream->frame_len);
+    qsort(origins, num_packets, sizeof(long long), qoa_int64_cmp);
+    long long origin = origins[num_packets / 2];
+
+    /* The stream starts at the earliest packet that agrees with the median
+     origin, the distance bound below is measured from there. */
+    int first = -1;
+    for (int i = 0; i < num_packets; i++) {
+      if (qoa_packet_origin(&packets[i], ref_sequence, stream->frame_len) != origin) continue;
+      if (first < 0 || packets[i].timestamp < packets[first].timestamp) first = i;
+    }
+    stream->sequence = packets[first].sequence;
+    stream->timestamp = packets[first].timestamp;
+  }
+
+  int kept = 0;
+  for (int i = 0; i < num_packets; i++) {
+    int distance = (int) (packets[i].sequence - stream->sequence);
+    if (qoa_packet_origin(&packets[i], stream->sequence, stream->frame_len) != (long long) stream->timestamp ||
+        distance > 0xffff || distance < (stream->valid ? 0 : -0xffff)) continue;
+    packets[kept++] = packets[i];
+  }
+  return kept;
+}
+
+/* Number of packets missing between two consecutive frames. Sequence numbers
+ wrap around, implausibly large jumps are treated as a restarted sender. */
+static unsigned int qoa_packet_gap(const qoa_packet_t *prev, const qoa_packet_t *next) {
+  unsigned int gap = next->sequence - prev->sequence - 1;
+  return gap < 0xffff ? gap : 0;
+}
+
+SEXP qoaDepacketize_(SEXP sPackets, SEXP sRepeat, SEXP sState) {
+  if (TYPEOF(sPackets) != VECSXP) Rf_error("packets must be a list of raw vectors");
+
+  int repeat = Rf_asLogical(sRepeat) == TRUE;
+  int n = LENGTH(sPackets);
+
+  /* The state of the previous call, as returned below: timestamp, sequence,
+   frame_len, samplerate and the last decoded frame as a matrix. */
+  qoa_desc qoa;
+  qoa_stream_t stream;
+  SEXP last = R_NilValue;
+  qoa.channels = 0;
+  stream.valid = 0;
+  if (sState != R_NilValue) {
+    if (TYPEOF(sState) != VECSXP || LENGTH(sState) != 5) Rf_error("invalid state");
+    last = VECTOR_ELT(sState, 4);
+    SEXP dims = Rf_getAttrib(last, R_DimSymbol);
+    if (TYPEOF(last) != INTSXP || dims == R_NilValue || LENGTH(dims) != 2 ||
+        INTEGER(dims)[1] < 1 || INTEGER(dims)[1] > QOA_MAX_CHANNELS) Rf_error("invalid state");
+    double timestamp = Rf_asReal(VECTOR_ELT(sState, 0));
+    if (!(timestamp >= 0 && timestamp <= 0xffffffff)) Rf_error("invalid state");
+    stream.valid = 1;
+    stream.timestamp = (qoa_uint64_t) timestamp;
+    stream.sequence = (unsigned int) Rf_asReal(VECTOR_ELT(sState, 1));
+    stream.frame_len = Rf_asInteger(VECTOR_ELT(sState, 2));
+    qoa.samplerate = Rf_asInteger(VECTOR_ELT(sState, 3));
+    qoa.channels = INTEGER(dims)[1];
+  }
+
+  /* All buffers are R_alloc()ed, so R releases them if one of the
+   allocations of the result raises an error. */
+  qoa_packet_t *packets = (qoa_packet_t *) R_alloc(n ? n : 1, sizeof(qoa_packet_t));
+
+  /* Collect all well-formed packets. Their channels and samplerate are only
+   checked below, so a packet with a damaged format still marks the place of
+   its frame. */
+  int num_packets = 0;
+  for (int i = 0; i < n; i++) {
+    SEXP packet = VECTOR_ELT(sPackets, i);
+    if (TYPEOF(packet) != RAWSXP || LENGTH(packet) < QOA_PACKET_HEADER_SIZE + 8) continue;
+
+    const unsigned char *bytes = RAW(packet);
+    unsigned int p = 0;
+    qoa_uint64_t header = qoa_read_u64(bytes, &p);
+    if ((header >> 32) != QOA_PACKET_MAGIC) continue;
+    qoa_uint64_t timestamp = qoa_read_u64(bytes, &p);
+    // sample indices of a QOA stream are 32 bit, anything beyond is damaged
+    if (timestamp > 0xffffffff) continue;
+
+    qoa_uint64_t frame_header = qoa_read_u64(bytes, &p);
+    unsigned int channels   = (frame_header >> 56) & 0x0000ff;
+    unsigned int samplerate = (frame_header >> 32) & 0xffffff;
+    unsigned int samples    = (frame_header >> 16) & 0x00ffff;
+    unsigned int frame_size = (frame_header      ) & 0x00ffff;
+    if (channels == 0 || channels > QOA_MAX_CHANNELS || samplerate == 0 || samples == 0) continue;
+
+    /* qoa_decode_frame() reads as many slices as the sample count asks for,
+     so the frame size has to match it exactly and fit into the packet. */
+    unsigned int slices = (samples + QOA_SLICE_LEN - 1) / QOA_SLICE_LEN;
+    if (frame_size != QOA_FRAME_SIZE(channels, slices) ||
+        frame_size > LENGTH(packet) - QOA_PACKET_HEADER_SIZE) continue;
+
+    packets[num_packets].frame = bytes + QOA_PACKET_HEADER_SIZE;
+    packets[num_packets].size = LENGTH(packet) - QOA_PACKET_HEADER_SIZE;
+    packets[num_packets].sequence = header & 0xffffffff;
+    packets[num_packets].samples = samples;
+    packets[num_packets].format = channels << 24 | samplerate;
+    packets[num_packets].timestamp = timestamp;
+    num_packets++;
+  }
+
+  /* The state or else the majority of the packets fixes channels and
+   samplerate. A packet which does not match is kept in place, but its frame
+   is concealed and reported as lost. */
+  if (!stream.valid && num_packets) {
+    unsigned int *formats = (unsigned int *) R_alloc(num_packets, sizeof(unsigned int));
+    for (int i = 0; i < num_packets; i++) formats[i] = packets[i].format;
+    qsort(formats, num_packets, sizeof(unsigned int), qoa_uint_cmp);
+    qoa.channels = formats[num_packets / 2] >> 24;
+    qoa.samplerate = formats[num_packets / 2] & 0xffffff;
+  }
+  for (int i = 0; i < num_packets; i++) {
+    packets[i].intact = packets[i].format == (qoa.channels << 24 | qoa.samplerate);
+  }
+
+  // a single damaged header must not move a frame over its neighbours
+  num_packets = qoa_packet_filter(packets, num_packets, &stream);
+
+  // without a state there is nothing to continue from
+  if (!num_packets && !stream.valid) Rf_error("no valid packets found");
+
+  // restore the original order, whatever order the packets arrived in
+  qsort(packets, num_packets, sizeof(qoa_packet_t), qoa_packet_cmp);
+
+  /* With a state the output continues exactly where the last call ended, a
+   gap before the first packet of this window is concealed and its packets
+   are reported as lost. */
+  qoa_packet_t expected;
+  expected.sequence = stream.sequence - 1;
+  expected.timestamp = stream.timestamp;
+  qoa_uint64_t start = stream.valid ? stream.timestamp : packets[0].timestamp;
+  qoa_uint64_t end = start;
+  int num_lost = 0;
+  for (int i = 0; i < num_packets; i++) {
+    if (packets[i].timestamp + packets[i].samples > end) end = packets[i].timestamp + packets[i].samples;
+    if (i > 0 && packets[i].timestamp != packets[i - 1].timestamp) num_lost += qoa_packet_gap(&packets[i - 1], &packets[i]);
+    num_lost++;  // in case the frame can not be decoded
+  }
+  if (stream.valid && num_packets) num_lost += qoa_packet_gap(&expected, &packets[0]);
+  if (end - start > 0x7fffffff / qoa.channels) Rf_error("packets span too many samples");
+  qoa.samples = end - start;
+
+  SEXP res = PROTECT(allocVector(INTSXP, qoa.samples * qoa.channels));
+  int *samples_ = INTEGER(res);
+  int *lost_ = (int *) R_alloc(num_lost ? num_lost : 1, sizeof(int));
+
+  // a frame header may announce up to 0xffff samples, size the buffers for it
+  short *frame_data = (short *) R_alloc(0xffff * qoa.channels, sizeof(short));
+  short *last_data = (short *) R_alloc(0xffff * qoa.channels, sizeof(short));
+
+  unsigned int cursor = 0;      // next output sample to be written
+  unsigned int last_len = 0;    // length of the last decoded frame
+  unsigned int gap_index = 0;   // position in the current concealed gap
+  unsigned int concealed = 0;
+  num_lost = 0;
+
+  // the last frame of the previous window is repeated if this one starts with a gap
+  if (last != R_NilValue) {
+    last_len = qoa_clamp(INTEGER(Rf_getAttrib(last, R_DimSymbol))[0], 0, 0xffff);
+    unsigned int rows = INTEGER(Rf_getAttrib(last, R_DimSymbol))[0];
+    for (unsigned int s = 0; s < last_len; s++) {
+      for (int c = 0; c < qoa.channels; c++) {
+        last_data[s * qoa.channels + c] = INTEGER(last)[s + c * rows];
+      }
+    }
+  }
+
+  for (int i = 0; i <= num_packets; i++) {
+    unsigned int frame_start = i < num_packets ? packets[i].timestamp - start : qoa.samples;
+
+    /* Conceal the gap up to this frame, either with silence or by looping
+     the last frame that was decoded. */
+    for (; cursor < frame_start; cursor++, gap_index++, concealed++) {
+      for (int c = 0; c < qoa.channels; c++) {
+        samples_[cursor + c * qoa.samples] = repeat && last_len ?
+          last_data[(gap_index % last_len) * qoa.channels + c] : 0;
+      }
+    }
+    if (i == num_packets) break;
+
+    // record gaps in the sequence numbers as lost packets
+    const qoa_packet_t *prev = i > 0 ? &packets[i - 1] : stream.valid ? &expected : NULL;
+    if (prev && packets[i].timestamp != prev->timestamp) {
+      unsigned int gap = qoa_packet_gap(prev, &packets[i]);
+      for (unsigned int g = 1; g <= gap; g++) lost_[num_lost++] = (int) (prev->sequence + g);
+    }
+
+    // duplicates and frames overlapping already written audio are skipped
+    if (frame_start < cursor) continue;
+
+    /* A broken frame is concealed together with the next gap and reported
+     as lost, unless a packet with the same timestamp came before it. */
+    unsigned int decoded_len;
+    if (!packets[i].intact ||
+        !qoa_decode_frame(packets[i].frame, packets[i].size, &qoa, frame_data, &decoded_len)) {
+      if (i == 0 || packets[i].timestamp != packets[i - 1].timestamp) lost_[num_lost++] = (int) packets[i].sequence;
+      continue;
+    }
+
+    for (unsigned int s = 0; s < decoded_len; s++) {
+      for (int c = 0; c < qoa.channels; c++) {
+        samples_[cursor + s + c * qoa.samples] = frame_data[s * qoa.channels + c];
+      }
+    }
+    cursor += decoded_len;
+    gap_index = 0;
+
+    short *tmp = last_data;
+    last_data = frame_data;
+    frame_data = tmp;
+    last_len = decoded_len;
+  }
+
+  unsigned int next_sequence = num_packets ? packets[num_packets - 1].sequence + 1 : stream.sequence;
+
+  SEXP lost = PROTECT(allocVector(INTSXP, num_lost));
+  for (int i = 0; i < num_lost; i++) INTEGER(lost)[i] = lost_[i];
+
+  // Set dimensions for export to R
+  SEXP dim;
+  dim = allocVector(INTSXP, 2);
+  INTEGER(dim)[0] = qoa.samples;
+  INTEGER(dim)[1] = qoa.channels;
+  setAttrib(res, R_DimSymbol, dim);
+
+  SEXP last_ = PROTECT(allocMatrix(INTSXP, last_len, qoa.channels));
+  for (unsigned int s = 0; s < last_len; s++) {
+    for (int c = 0; c < qoa.channels; c++) {
+      INTEGER(last_)[s + c * last_len] = last_data[s * qoa.channels + c];
+    }
+  }
+
+  SEXP state = PROTECT(allocVector(VECSXP, 5));
+  SET_VECTOR_ELT(state, 0, Rf_ScalarReal((double) (start + qoa.samples)));
+  SET_VECTOR_ELT(state, 1, Rf_ScalarReal((double) next_sequence));
+  SET_VECTOR_ELT(state, 2, ScalarInteger(stream.frame_len));
+  SET_VECTOR_ELT(state, 3, ScalarInteger(qoa.samplerate));
+  SET_VECTOR_ELT(state, 4, last_);
+
+  SEXP state_names = PROTECT(allocVector(STRSXP, 5));
+  SET_STRING_ELT(state_names, 0, mkChar("timestamp"));
+  SET_STRING_ELT(state_names, 1, mkChar("sequence"));
+  SET_STRING_ELT(state_names, 2, mkChar("frame_len"));
+  SET_STRING_ELT(state_names, 3, mkChar("samplerate"));
+  SET_STRING_ELT(state_names, 4, mkChar("last"));
+  setAttrib(state, R_NamesSymbol, state_names);
+
+  SEXP list_ = PROTECT(allocVector(VECSXP, 8));
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Add members to the list
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SET_VECTOR_ELT(list_, 0, res);
+  SET_VECTOR_ELT(list_, 1, ScalarInteger(qoa.channels));
+  SET_VECTOR_ELT(list_, 2, ScalarInteger(qoa.samplerate));
+  SET_VECTOR_ELT(list_, 3, ScalarInteger(qoa.samples));
+  SET_VECTOR_ELT(list_, 4, Rf_ScalarReal((double) start));
+  SET_VECTOR_ELT(list_, 5, lost);
+  SET_VECTOR_ELT(list_, 6, ScalarInteger(concealed));
+  SET_VECTOR_ELT(list_, 7, state);
+
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  // Set the names on the list.
+  //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+  SEXP names = PROTECT(allocVector(STRSXP, 8));
+  SET_STRING_ELT(names, 0, mkChar("data"));
+  SET_STRING_ELT(names, 1, mkChar("channels"));
+  SET_STRING_ELT(names, 2, mkChar("samplerate"));
+  SET_STRING_ELT(names, 3, mkChar("samples"));
+  SET_STRING_ELT(names, 4, mkChar("timestamp"));
+  SET_STRING_ELT(names, 5, mkChar("lost"));
+  SET_STRING_ELT(names, 6, mkChar("concealed"));
+  SET_STRING_ELT(names, 7, mkChar("state"));
+
+  setAttrib(list_, R_NamesSymbol, names);
+
+  UNPROTECT(7);
+
+  return list_;
+}
@@ -91,6 +91,7 @@ typedef struct {
 #endif
   } qoa_desc;
 
+  void qoa_encode_init(qoa_desc *qoa);
   unsigned int qoa_encode_header(qoa_desc *qoa, unsigned char *bytes);
   unsigned int qoa_encode_frame(const short *sample_data, qoa_desc *qoa, unsigned int frame_len, unsigned char *bytes);
   void *qoa_encode(const short *sample_data, qoa_desc *qoa, unsigned int *out_len);
@@ -102,6 +103,8 @@ typedef struct {
 
   int qoa_write(const char *filename, const short *sample_data, qoa_desc *qoa);
   void *qoa_read(const char *filename, qoa_desc *qoa);
+  unsigned char *qoa_read_bytes(const char *filename, int *size);
+  void qoa_get_frame(SEXP sample_data, qoa_desc *qoa, unsigned int sample_index, unsigned int frame_len, int *column, short *frame);
 
 #endif /* QOA_H */
 
@@ -137,38 +137,46 @@ short *qoa_decode(const unsigned char *bytes, int size, qoa_desc *qoa) {
   return sample_data;
 }
 
-SEXP qoaRead_(SEXP sFilename) {
-  const char *fn;
-  void *data;
+unsigned char *qoa_read_bytes(const char *fn, int *size) {
   FILE *f=0;
-  qoa_desc qoa;
+  unsigned char *data;
 
-  int bytes_read;
-  short *sample_data;
-
-  if (TYPEOF(sFilename) != STRSXP || LENGTH(sFilename) < 1) Rf_error("invalid filename");
-  fn = CHAR(STRING_ELT(sFilename, 0));
   f = fopen(fn, "rb");
   if (!f) Rf_error("unable to open %s", fn);
 
   // read size of bin file and open it, buffer result into data
   fseek(f, 0, SEEK_END);
-  int size = ftell(f);
-  if (size <= 0) {
+  int file_size = ftell(f);
+  if (file_size <= 0) {
     fclose(f);
     Rf_error("File has size 0");
   }
   fseek(f, 0, SEEK_SET);
 
-  data = QOA_MALLOC(size);
+  data = QOA_MALLOC(file_size);
   if (!data) {
     fclose(f);
     Rf_error("Malloc error!");
   }
 
-  bytes_read = fread(data, 1, size, f);
+  *size = fread(data, 1, file_size, f);
   fclose(f);
 
+  return data;
+}
+
+SEXP qoaRead_(SEXP sFilename) {
+  const char *fn;
+  void *data;
+  qoa_desc qoa;
+
+  int bytes_read;
+  short *sample_data;
+
+  if (TYPEOF(sFilename) != STRSXP || LENGTH(sFilename) < 1) Rf_error("invalid filename");
+  fn = CHAR(STRING_ELT(sFilename, 0));
+  data = qoa_read_bytes(fn, &bytes_read);
+
   sample_data = qoa_decode(data, bytes_read, &qoa);
   QOA_FREE(data);
 
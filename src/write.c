@@ -107,6 +107,23 @@ unsigned int qoa_encode_frame(const short *sample_data, qoa_desc *qoa, unsigned
   return p;
 }
 
+void qoa_encode_init(qoa_desc *qoa) {
+  for (int c = 0; c < qoa->channels; c++) {
+    /* Set the initial LMS weights to {0, 0, -1, 2}. This helps with the
+     prediction of the first few ms of a file. */
+    qoa->lms[c].weights[0] = 0;
+    qoa->lms[c].weights[1] = 0;
+    qoa->lms[c].weights[2] = -(1<<13);
+    qoa->lms[c].weights[3] =  (1<<14);
+
+    /* Explicitly set the history samples to 0, as we might have some
+     garbage in there. */
+    for (int i = 0; i < QOA_LMS_LEN; i++) {
+      qoa->lms[c].history[i] = 0;
+    }
+  }
+}
+
 void *qoa_encode(const short *sample_data, qoa_desc *qoa, unsigned int *out_len) {
   if (
       qoa->samples == 0 ||
@@ -126,20 +143,7 @@ void *qoa_encode(const short *sample_data, qoa_desc *qoa, unsigned int *out_len)
 
   unsigned char *bytes = QOA_MALLOC(encoded_size);
 
-  for (int c = 0; c < qoa->channels; c++) {
-    /* Set the initial LMS weights to {0, 0, -1, 2}. This helps with the
-     prediction of the first few ms of a file. */
-    qoa->lms[c].weights[0] = 0;
-    qoa->lms[c].weights[1] = 0;
-    qoa->lms[c].weights[2] = -(1<<13);
-    qoa->lms[c].weights[3] =  (1<<14);
-
-    /* Explicitly set the history samples to 0, as we might have some
-     garbage in there. */
-    for (int i = 0; i < QOA_LMS_LEN; i++) {
-      qoa->lms[c].history[i] = 0;
-    }
-  }
+  qoa_encode_init(qoa);
 
 
   /* Encode the header and go through all frames */
@@ -161,27 +165,79 @@ void *qoa_encode(const short *sample_data, qoa_desc *qoa, unsigned int *out_len)
 }
 
 
-SEXP qoaWrite_(SEXP sample_data, SEXP samplerate, SEXP sFilename){
-  FILE *f = 0;
-  int raw_array = 0;
+/* Fetches one frame of the column-major R matrix and interleaves it for
+ qoa_encode_frame(). Each channel is pulled as one contiguous region, so ALTREP
+ and file-backed vectors are never materialised as a whole. */
+void qoa_get_frame(SEXP sample_data, qoa_desc *qoa, unsigned int sample_index, unsigned int frame_len, int *column, short *frame) {
+  for (int c = 0; c < qoa->channels; c++) {
+    R_xlen_t start = (R_xlen_t) c * qoa->samples + sample_index;
+    if (TYPEOF(sample_data) == RAWSXP) {
+      RAW_GET_REGION(sample_data, start, frame_len, (Rbyte *) column);
+      for (int i = 0; i < frame_len; i++) {
+        frame[i * qoa->channels + c] = ((Rbyte *) column)[i];
+      }
+    } else {
+      INTEGER_GET_REGION(sample_data, start, frame_len, column);
+      for (int i = 0; i < frame_len; i++) {
+        frame[i * qoa->channels + c] = (short) column[i];
+      }
+    }
+  }
+}
+
+typedef struct {
+  SEXP sample_data;
+  qoa_desc *qoa;
+  int *column;
+  short *frame;
+  unsigned char *bytes;
   const char *fn;
-  unsigned int size;
-  void *encoded;
+  FILE *f;
+} qoa_write_t;
+
+static SEXP qoa_write_frames(void *data) {
+  qoa_write_t *w = (qoa_write_t *) data;
+
+  qoa_encode_init(w->qoa);
+  unsigned int p = qoa_encode_header(w->qoa, w->bytes);
+  if (w->f) {
+    fwrite(w->bytes, 1, p, w->f);
+    p = 0;
+  }
+
+  unsigned int frame_len = QOA_FRAME_LEN;
+  for (unsigned int sample_index = 0; sample_index < w->qoa->samples; sample_index += frame_len) {
+    frame_len = qoa_clamp(QOA_FRAME_LEN, 0, w->qoa->samples - sample_index);
+    qoa_get_frame(w->sample_data, w->qoa, sample_index, frame_len, w->column, w->frame);
+
+    unsigned int frame_size = qoa_encode_frame(w->frame, w->qoa, frame_len, w->bytes + p);
+    if (w->f) {
+      fwrite(w->bytes, 1, frame_size, w->f);
+    } else {
+      p += frame_size;
+    }
+  }
+  return R_NilValue;
+}
 
+/* Reading ALTREP or file-backed input may raise an R error half way through.
+ The file is closed in any case and removed if it is incomplete. */
+static void qoa_write_cleanup(void *data, Rboolean jump) {
+  qoa_write_t *w = (qoa_write_t *) data;
+  if (w->f) {
+    fclose(w->f);
+    w->f = 0;
+    if (jump) remove(w->fn);
+  }
+}
 
+SEXP qoaWrite_(SEXP sample_data, SEXP samplerate, SEXP sFilename){
   // check type of image-input
-  if (TYPEOF(sample_data) == RAWSXP) raw_array = 1;
-  if (!raw_array && TYPEOF(sample_data) != INTSXP)
+  if (TYPEOF(sample_data) != RAWSXP && TYPEOF(sample_data) != INTSXP)
     Rf_error("image must be a matrix or array of raw or integer numbers");
 
-  if (TYPEOF(sFilename) == RAWSXP) {
-    f = 0;
-  } else {
-    if (TYPEOF(sFilename) != STRSXP || LENGTH(sFilename) < 1) Rf_error("invalid filename");
-    fn = CHAR(STRING_ELT(sFilename, 0));
-    f = fopen(fn, "wb");
-    if (!f) Rf_error("unable to create %s", fn);
-  }
+  if (TYPEOF(sFilename) != RAWSXP && (TYPEOF(sFilename) != STRSXP || LENGTH(sFilename) < 1))
+    Rf_error("invalid filename");
 
   SEXP dims = Rf_getAttrib(sample_data, R_DimSymbol);
   if (dims == R_NilValue || TYPEOF(dims) != INTSXP || LENGTH(dims) < 1 || LENGTH(dims) > 8)
@@ -191,49 +247,53 @@ SEXP qoaWrite_(SEXP sample_data, SEXP samplerate, SEXP sFilename){
   qoa_desc qoa;
   qoa.samplerate = Rf_asInteger(samplerate);
   qoa.samples = INTEGER(dims)[0];
-  qoa.channels = INTEGER(dims)[1];
-
-  // prepare incoming matrix as sample stream:
-  short * sample_values = malloc(qoa.channels * qoa.samples * sizeof(short));
+  qoa.channels = LENGTH(dims) > 1 ? INTEGER(dims)[1] : 1;
 
-  if (!sample_values){
-    fclose(f);
-    Rf_error("Malloc error!");
-  }
-
-  // Convert matrix to single 1D array for qoa_encode
-  int sampleCounter = 0;
-  for (int i = 0; i < qoa.samples; i++){
-    for(int j = 0; j < qoa.channels; j++){
-      sample_values[sampleCounter] = (short) INTEGER(sample_data)[i+j*qoa.samples];
-      sampleCounter++;
-    }
-  }
-
-  encoded = qoa_encode(sample_values, &qoa, &size);
-  QOA_FREE(sample_values);
-
-  if (!encoded) {
-    fclose(f);
+  if (
+      qoa.samples == 0 ||
+        qoa.samplerate == 0 || qoa.samplerate > 0xffffff ||
+        qoa.channels == 0 || qoa.channels > QOA_MAX_CHANNELS
+  ) {
     Rf_error("Encoding went wrong!");
-    return R_NilValue;
   }
 
-  if (f){
-    fwrite(encoded, 1, size, f);
-    fclose(f);
-    QOA_FREE(encoded);
-    return R_NilValue;
-  }
+  /* Calculate the encoded size like qoa_encode(), so a raw result can be
+   allocated once and encoded into directly. */
+  unsigned int num_frames = (qoa.samples + QOA_FRAME_LEN-1) / QOA_FRAME_LEN;
+  unsigned int num_slices = (qoa.samples + QOA_SLICE_LEN-1) / QOA_SLICE_LEN;
+  double encoded_size = 8.0 +
+    num_frames * 8.0 +
+    num_frames * QOA_LMS_LEN * 4.0 * qoa.channels +
+    num_slices * 8.0 * qoa.channels;
 
-  // copy encoded data into SEXP res
-  SEXP res = PROTECT(allocVector(RAWSXP, size));
-  unsigned char *byte = RAW(res);
-  for (int i=0; i<size; i++){
-    byte[i] = ((unsigned char*) encoded)[i];
+  SEXP res = R_NilValue;
+  if (TYPEOF(sFilename) == RAWSXP) {
+    if (encoded_size > 0x7fffffff) Rf_error("encoded data too large for a raw vector, write to a file instead");
+    res = allocVector(RAWSXP, (R_xlen_t) encoded_size);
+  }
+  PROTECT(res);
+
+  /* Only one frame of input and output is held in memory at a time: the
+   channel columns are pulled frame by frame, interleaved and encoded. The
+   buffers are R_alloc()ed, so R releases them on error as well. */
+  qoa_write_t w;
+  w.sample_data = sample_data;
+  w.qoa = &qoa;
+  w.column = (int *) R_alloc(QOA_FRAME_LEN, sizeof(int));
+  w.frame = (short *) R_alloc(QOA_FRAME_LEN * qoa.channels, sizeof(short));
+  w.bytes = res == R_NilValue ? (unsigned char *) R_alloc(QOA_FRAME_SIZE(qoa.channels, QOA_SLICES_PER_FRAME), 1) : RAW(res);
+  w.fn = 0;
+  w.f = 0;
+
+  // nothing may raise an R error between opening the file and protecting it
+  SEXP cont = PROTECT(R_MakeUnwindCont());
+  if (res == R_NilValue) {
+    w.fn = CHAR(STRING_ELT(sFilename, 0));
+    w.f = fopen(w.fn, "wb");
+    if (!w.f) Rf_error("unable to create %s", w.fn);
   }
+  R_UnwindProtect(qoa_write_frames, &w, qoa_write_cleanup, &w, cont);
 
-  UNPROTECT(1);
-  QOA_FREE(encoded);
+  UNPROTECT(2);
   return res;
   }